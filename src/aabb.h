@@ -0,0 +1,81 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "rtweekend.h"
+#include <utility>
+
+// axis aligned bounding box, stored as one interval per axis
+class aabb{
+    public:
+        interval x, y, z;
+
+        aabb() {}  // intervals default to empty, so the box contains nothing
+        aabb(const interval& ix, const interval& iy, const interval& iz) : x(ix), y(iy), z(iz) {}
+
+        // box with a and b as opposite corners, in any order
+        aabb(const point3& a, const point3& b){
+            x = interval(fmin(a[0], b[0]), fmax(a[0], b[0]));
+            y = interval(fmin(a[1], b[1]), fmax(a[1], b[1]));
+            z = interval(fmin(a[2], b[2]), fmax(a[2], b[2]));
+        }
+
+        aabb(const aabb& a, const aabb& b) : x(a.x, b.x), y(a.y, b.y), z(a.z, b.z) {}
+
+        const interval& axis(int n) const {
+            if(n == 1) return y;
+            if(n == 2) return z;
+            return x;
+        }
+
+        bool is_empty() const {
+            return x.size() < 0 || y.size() < 0 || z.size() < 0;
+        }
+
+        point3 centroid() const {
+            return point3(0.5*(x.min + x.max), 0.5*(y.min + y.max), 0.5*(z.min + z.max));
+        }
+
+        double surface_area() const {
+            if(is_empty()) return 0;
+
+            auto dx = x.size();
+            auto dy = y.size();
+            auto dz = z.size();
+            return 2.0 * (dx*dy + dy*dz + dz*dx);
+        }
+
+        int longest_axis() const {
+            if(x.size() > y.size()){
+                return x.size() > z.size() ? 0 : 2;
+            }
+            return y.size() > z.size() ? 1 : 2;
+        }
+
+        // slab test, takes the reciprocal of the ray direction so it can be computed once per traversal
+        bool hit(const point3& origin, const vec3& inv_dir, interval ray_t) const {
+            for(int a = 0; a < 3; a++){
+                auto t0 = (axis(a).min - origin[a]) * inv_dir[a];
+                auto t1 = (axis(a).max - origin[a]) * inv_dir[a];
+
+                if(inv_dir[a] < 0){
+                    std::swap(t0, t1);
+                }
+
+                if(t0 > ray_t.min) ray_t.min = t0;
+                if(t1 < ray_t.max) ray_t.max = t1;
+
+                if(ray_t.max < ray_t.min){
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        bool hit(ray& r, interval ray_t) const {
+            auto dir = r.direction();
+            return hit(r.origin(), vec3(1/dir[0], 1/dir[1], 1/dir[2]), ray_t);
+        }
+};
+
+#endif
@@ -0,0 +1,481 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+// node of a flattened bvh. children are always stored after their parent, so walking the node array
+// backwards visits every child before its parent, which is what lets a refit run in a single O(n) pass
+class bvh_node{
+    public:
+        aabb box;
+        int left = -1;    // child node indices, -1 for a leaf
+        int right = -1;
+        int first = 0;    // range of bvh_tree::prim_index covered by this subtree
+        int count = 0;    // 0 marks a node orphaned by a partial rebuild
+        int axis = 0;     // split axis, used to visit the nearer child first
+        int depth = 0;
+        double cost = 0;        // SAH cost of the subtree, left in units of surface area
+        double built_cost = 0;  // cost when the subtree was last built, used to detect degradation
+
+        bool is_leaf() const {return left < 0;}
+};
+
+// bvh over an array of primitive bounding boxes. the tree only ever sees boxes and indices, so the
+// same structure can sit behind a list of hittables or the triangles of a mesh
+class bvh_tree{
+    public:
+        int max_leaf_size = 4;
+        double traversal_cost = 1.0;
+        double intersect_cost = 1.0;
+
+        std::vector<bvh_node> nodes;
+        std::vector<int> prim_index;  // leaves reference primitives through this array
+
+        void build(const std::vector<aabb>& prim_boxes){
+            nodes.clear();
+            dead_nodes = 0;
+
+            int n = static_cast<int>(prim_boxes.size());
+            prim_index.resize(n);
+            for(int i = 0; i < n; i++){
+                prim_index[i] = i;
+            }
+
+            if(n == 0) return;
+
+            nodes.reserve(2 * (n / max_leaf_size + 1));
+            nodes.push_back(bvh_node());
+            build_node(prim_boxes, 0, 0, n, 0);
+        }
+
+        // recompute every box bottom-up from the current primitive boxes. subtrees whose SAH cost has grown
+        // past rebuild_threshold times their cost when built are rebuilt in place.
+        // returns the number of subtrees that had to be rebuilt
+        int refit(const std::vector<aabb>& prim_boxes, double rebuild_threshold){
+            if(nodes.empty() || prim_boxes.size() != prim_index.size()){
+                build(prim_boxes);
+                return 1;
+            }
+
+            update_bounds(prim_boxes);
+
+            int rebuilt = 0;
+            std::vector<int> stack{0};
+
+            while(!stack.empty()){
+                int i = stack.back();
+                stack.pop_back();
+
+                if(nodes[i].is_leaf()) continue;
+
+                if(nodes[i].cost > rebuild_threshold * nodes[i].built_cost){
+                    rebuild_subtree(prim_boxes, i);
+                    rebuilt++;
+                } else {
+                    stack.push_back(nodes[i].left);
+                    stack.push_back(nodes[i].right);
+                }
+            }
+
+            if(rebuilt > 0){
+                if(dead_nodes > static_cast<int>(nodes.size()) - dead_nodes){
+                    // too much of the node array is orphaned, a full build compacts it again
+                    build(prim_boxes);
+                } else {
+                    // ancestors of the rebuilt subtrees still carry their old cost
+                    update_bounds(prim_boxes);
+                }
+            }
+
+            return rebuilt;
+        }
+
+        // SAH cost normalised by the root area, i.e. the expected cost of tracing a ray that hits the root box
+        double sah_cost() const {
+            if(nodes.empty()) return 0;
+
+            auto area = nodes[0].box.surface_area();
+            return area > 0 ? nodes[0].cost / area : 0;
+        }
+
+        // hit_prim(prim, ray_t, t) tests a single primitive and on a hit sets t and returns true,
+        // ray_t is shrunk to the closest hit so far as the traversal goes
+        template<typename hit_prim_fn>
+        bool hit(ray& r, interval ray_t, hit_prim_fn hit_prim) const {
+            if(nodes.empty()) return false;
+
+            auto origin = r.origin();
+            auto dir = r.direction();
+            vec3 inv_dir(1/dir[0], 1/dir[1], 1/dir[2]);
+
+            bool hit_anything = false;
+            int stack[max_stack_depth];
+            int top = 0;
+            stack[top++] = 0;
+
+            while(top > 0){
+                const auto& node = nodes[stack[--top]];
+
+                if(!node.box.hit(origin, inv_dir, ray_t)) continue;
+
+                if(node.is_leaf()){
+                    for(int k = node.first; k < node.first + node.count; k++){
+                        double t;
+                        if(hit_prim(prim_index[k], ray_t, t)){
+                            hit_anything = true;
+                            ray_t.max = t;
+                        }
+                    }
+                } else {
+                    // push the far child first so the near one is popped next
+                    bool left_is_near = dir[node.axis] >= 0;
+                    stack[top++] = left_is_near ? node.right : node.left;
+                    stack[top++] = left_is_near ? node.left : node.right;
+                }
+            }
+
+            return hit_anything;
+        }
+
+    private:
+        static const int bin_count = 12;
+        static const int max_sah_depth = 32;    // below this depth splits fall back to the median, which bounds
+        static const int max_stack_depth = 64;  // the tree depth by max_sah_depth + log2(n)
+
+        int dead_nodes = 0;
+
+        // builds the subtree rooted at nodes[index] over prim_index[first, first+count). children are appended to
+        // the node array, so references into it are not held across the recursive calls
+        void build_node(const std::vector<aabb>& prim_boxes, int index, int first, int count, int depth){
+            aabb box;
+            aabb centroid_box;
+
+            for(int k = first; k < first + count; k++){
+                const auto& prim_box = prim_boxes[prim_index[k]];
+                auto c = prim_box.centroid();
+                box = aabb(box, prim_box);
+                centroid_box = aabb(centroid_box, aabb(c, c));
+            }
+
+            auto area = box.surface_area();
+            auto& node = nodes[index];
+            node.box = box;
+            node.first = first;
+            node.count = count;
+            node.depth = depth;
+            node.left = node.right = -1;
+
+            if(count <= max_leaf_size){
+                node.cost = node.built_cost = intersect_cost * count * area;
+                return;
+            }
+
+            int axis = centroid_box.longest_axis();
+            int mid = split(prim_boxes, centroid_box, axis, first, count, depth);
+
+            int left = static_cast<int>(nodes.size());
+            nodes.push_back(bvh_node());
+            int right = static_cast<int>(nodes.size());
+            nodes.push_back(bvh_node());
+
+            build_node(prim_boxes, left, first, mid - first, depth + 1);
+            build_node(prim_boxes, right, mid, first + count - mid, depth + 1);
+
+            nodes[index].left = left;
+            nodes[index].right = right;
+            nodes[index].axis = axis;
+            nodes[index].cost = nodes[index].built_cost = traversal_cost * area + nodes[left].cost + nodes[right].cost;
+        }
+
+        // partitions prim_index[first, first+count) along axis and returns the first index of the right half,
+        // using a binned SAH split where possible
+        int split(const std::vector<aabb>& prim_boxes, const aabb& centroid_box, int axis, int first, int count, int depth){
+            auto extent = centroid_box.axis(axis);
+            auto begin = prim_index.begin() + first;
+            auto end = begin + count;
+
+            if(extent.size() <= 0){
+                // every centroid coincides, any split is as good as any other
+                return first + count / 2;
+            }
+
+            if(depth >= max_sah_depth){
+                std::nth_element(begin, begin + count / 2, end, [&](int a, int b){
+                    return prim_boxes[a].centroid()[axis] < prim_boxes[b].centroid()[axis];
+                });
+                return first + count / 2;
+            }
+
+            auto bin_of = [&](int prim){
+                auto b = static_cast<int>(bin_count * (prim_boxes[prim].centroid()[axis] - extent.min) / extent.size());
+                return b < bin_count ? b : bin_count - 1;
+            };
+
+            int bin_counts[bin_count] = {0};
+            aabb bin_boxes[bin_count];
+
+            for(auto it = begin; it != end; ++it){
+                int b = bin_of(*it);
+                bin_counts[b]++;
+                bin_boxes[b] = aabb(bin_boxes[b], prim_boxes[*it]);
+            }
+
+            // sweep from the right to get the cost of everything above each candidate plane
+            double right_costs[bin_count];
+            aabb right_box;
+            int right_count = 0;
+            for(int b = bin_count - 1; b > 0; b--){
+                right_box = aabb(right_box, bin_boxes[b]);
+                right_count += bin_counts[b];
+                right_costs[b] = right_count * right_box.surface_area();
+            }
+
+            // then from the left, the plane after bin b splits [0, b] from [b+1, bin_count)
+            int best_bin = 0;
+            double best_cost = infinity;
+            aabb left_box;
+            int left_count = 0;
+            for(int b = 0; b < bin_count - 1; b++){
+                left_box = aabb(left_box, bin_boxes[b]);
+                left_count += bin_counts[b];
+
+                auto cost = left_count * left_box.surface_area() + right_costs[b + 1];
+                if(left_count > 0 && left_count < count && cost < best_cost){
+                    best_cost = cost;
+                    best_bin = b;
+                }
+            }
+
+            auto mid = std::partition(begin, end, [&](int prim){
+                return bin_of(prim) <= best_bin;
+            });
+
+            return static_cast<int>(mid - prim_index.begin());
+        }
+
+        // recompute boxes and costs bottom-up without changing the topology
+        void update_bounds(const std::vector<aabb>& prim_boxes){
+            for(int i = static_cast<int>(nodes.size()) - 1; i >= 0; i--){
+                auto& node = nodes[i];
+
+                if(node.count == 0) continue;
+
+                if(node.is_leaf()){
+                    aabb box;
+                    for(int k = node.first; k < node.first + node.count; k++){
+                        box = aabb(box, prim_boxes[prim_index[k]]);
+                    }
+                    node.box = box;
+                    node.cost = intersect_cost * node.count * box.surface_area();
+                } else {
+                    node.box = aabb(nodes[node.left].box, nodes[node.right].box);
+                    node.cost = traversal_cost * node.box.surface_area() + nodes[node.left].cost + nodes[node.right].cost;
+                }
+            }
+        }
+
+        // rebuild the subtree rooted at nodes[index] over the same primitives. the root keeps its slot so the
+        // parent link stays valid, the old descendants are orphaned and the new ones appended
+        void rebuild_subtree(const std::vector<aabb>& prim_boxes, int index){
+            std::vector<int> stack{nodes[index].left, nodes[index].right};
+
+            while(!stack.empty()){
+                auto& node = nodes[stack.back()];
+                stack.pop_back();
+
+                if(!node.is_leaf()){
+                    stack.push_back(node.left);
+                    stack.push_back(node.right);
+                }
+
+                node.count = 0;
+                dead_nodes++;
+            }
+
+            build_node(prim_boxes, index, nodes[index].first, nodes[index].count, nodes[index].depth);
+        }
+};
+
+// 32 byte node of a static_bvh. the bounds are rounded outwards to floats, and the two children of an internal
+// node sit next to each other so only the first needs to be stored
+class static_bvh_node{
+    public:
+        float min[3];
+        float max[3];
+        int32_t offset;   // left child for internal nodes (the right one is offset+1), first primitive for leaves
+        uint16_t count;   // primitives in a leaf, 0 for internal nodes
+        uint16_t axis;    // split axis, used to visit the nearer child first
+};
+
+// read only bvh for geometry that never moves, so it drops everything bvh_tree keeps for refitting. it is built
+// through a bvh_tree and then packed, so the build briefly needs the memory of both
+class static_bvh{
+    public:
+        int max_leaf_size = 4;
+        std::vector<static_bvh_node> nodes;
+
+        // returns the order the primitives have to be stored in afterwards, so that leaf k covers primitives
+        // [offset, offset+count) of the reordered array
+        std::vector<int> build(const std::vector<aabb>& prim_boxes){
+            bvh_tree tree;
+            tree.max_leaf_size = max_leaf_size;
+            tree.build(prim_boxes);
+
+            nodes.assign(tree.nodes.size(), static_bvh_node());
+
+            for(size_t i = 0; i < tree.nodes.size(); i++){
+                const auto& node = tree.nodes[i];
+                auto& packed = nodes[i];
+
+                for(int a = 0; a < 3; a++){
+                    packed.min[a] = round_down(node.box.axis(a).min);
+                    packed.max[a] = round_up(node.box.axis(a).max);
+                }
+
+                packed.offset = node.is_leaf() ? node.first : node.left;
+                packed.count = static_cast<uint16_t>(node.is_leaf() ? node.count : 0);
+                packed.axis = static_cast<uint16_t>(node.axis);
+            }
+
+            return std::move(tree.prim_index);
+        }
+
+        aabb bounding_box() const {
+            if(nodes.empty()) return aabb();
+
+            const auto& root = nodes[0];
+            return aabb(point3(root.min[0], root.min[1], root.min[2]), point3(root.max[0], root.max[1], root.max[2]));
+        }
+
+        // same contract as bvh_tree::hit, with prim being an index into the reordered primitives
+        template<typename hit_prim_fn>
+        bool hit(ray& r, interval ray_t, hit_prim_fn hit_prim) const {
+            if(nodes.empty()) return false;
+
+            auto origin = r.origin();
+            auto dir = r.direction();
+            vec3 inv_dir(1/dir[0], 1/dir[1], 1/dir[2]);
+
+            bool hit_anything = false;
+            int stack[max_stack_depth];
+            int top = 0;
+            stack[top++] = 0;
+
+            while(top > 0){
+                const auto& node = nodes[stack[--top]];
+
+                if(!hit_box(node, origin, inv_dir, ray_t)) continue;
+
+                if(node.count > 0){
+                    for(int k = node.offset; k < node.offset + node.count; k++){
+                        double t;
+                        if(hit_prim(k, ray_t, t)){
+                            hit_anything = true;
+                            ray_t.max = t;
+                        }
+                    }
+                } else {
+                    // push the far child first so the near one is popped next
+                    bool left_is_near = dir[node.axis] >= 0;
+                    stack[top++] = left_is_near ? node.offset + 1 : node.offset;
+                    stack[top++] = left_is_near ? node.offset : node.offset + 1;
+                }
+            }
+
+            return hit_anything;
+        }
+
+    private:
+        static const int max_stack_depth = 64;  // same depth bound as the bvh_tree it is built from
+
+        static float round_down(double x){
+            auto f = static_cast<float>(x);
+            return f > x ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+        }
+
+        static float round_up(double x){
+            auto f = static_cast<float>(x);
+            return f < x ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+        }
+
+        static bool hit_box(const static_bvh_node& node, const point3& origin, const vec3& inv_dir, interval ray_t){
+            for(int a = 0; a < 3; a++){
+                auto t0 = (node.min[a] - origin[a]) * inv_dir[a];
+                auto t1 = (node.max[a] - origin[a]) * inv_dir[a];
+
+                if(inv_dir[a] < 0){
+                    std::swap(t0, t1);
+                }
+
+                if(t0 > ray_t.min) ray_t.min = t0;
+                if(t1 < ray_t.max) ray_t.max = t1;
+
+                if(ray_t.max < ray_t.min){
+                    return false;
+                }
+            }
+
+            return true;
+        }
+};
+
+// bvh over a list of hittables. the objects are shared with the list it was built from, so moving one of them
+// only needs a call to refit() rather than a full rebuild
+class bvh : public hittable{
+    public:
+        double rebuild_threshold = 1.5;  // rebuild a subtree once its SAH cost has grown by this factor
+
+        bvh(const hittable_list& list) : objects(list.objects) {
+            rebuild();
+        }
+
+        void rebuild(){
+            tree.build(prim_boxes());
+        }
+
+        // refits the tree to the current object bounds, returns the number of subtrees that were rebuilt
+        int refit(){
+            return tree.refit(prim_boxes(), rebuild_threshold);
+        }
+
+        double sah_cost() const {
+            return tree.sah_cost();
+        }
+
+        bool hit(ray& r, interval ray_t, hit_record& rec) const override {
+            hit_record temp_rec;
+
+            return tree.hit(r, ray_t, [&](int prim, interval prim_t, double& t){
+                if(!objects[prim]->hit(r, prim_t, temp_rec)) return false;
+
+                rec = temp_rec;
+                t = temp_rec.t;
+                return true;
+            });
+        }
+
+        aabb bounding_box() const override {
+            return tree.nodes.empty() ? aabb() : tree.nodes[0].box;
+        }
+
+    private:
+        std::vector<shared_ptr<hittable>> objects;
+        bvh_tree tree;
+        std::vector<aabb> boxes;  // kept between refits to avoid reallocating every frame
+
+        const std::vector<aabb>& prim_boxes(){
+            boxes.resize(objects.size());
+            for(size_t i = 0; i < objects.size(); i++){
+                boxes[i] = objects[i]->bounding_box();
+            }
+            return boxes;
+        }
+};
+
+#endif
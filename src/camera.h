@@ -42,6 +42,8 @@ class camera{
         }
 
     private:
+        friend class previewer;  // the preview renders through a reduced resolution copy of the camera
+
         int image_height;
         point3 camera_centre;
         vec3 pixel00_loc;
@@ -53,7 +55,8 @@ class camera{
         vec3 defocus_disk_u;
         vec3 defocus_disk_v;
       
-        color ray_color(ray& r, int max_depth, const hittable& world){
+        // if hit_distance is given it is set to the distance to the first hit, or infinity if the ray escapes
+        color ray_color(ray& r, int max_depth, const hittable& world, double* hit_distance = nullptr){
             if(max_depth <= 0){
                 return color(0,0,0);
             }
@@ -61,6 +64,8 @@ class camera{
             hit_record rec;
 
             if(world.hit(r, interval(0.001, infinity), rec)){
+                if(hit_distance) *hit_distance = rec.t * r.direction().length();
+
                 color attenuation;
                 ray scattered;
 
@@ -71,6 +76,8 @@ class camera{
                 return color(0,0,0);
             }
 
+            if(hit_distance) *hit_distance = infinity;
+
             vec3 unit_direction = unit_vector(r.direction());
             auto a = 0.5*(unit_direction.y() + 1.0);
             return (1.0-a)*color(1.0, 1.0, 1.0) + a*color(0.5, 0.7, 1.0);
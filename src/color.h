@@ -33,5 +33,18 @@ void write_color(std::ostream& out, color pixel_color, int samples_per_pixel){
     << static_cast<int>(256 * intensity.clamp(b)) << '\n';
 }
 
+// same as write_color, but writes the three bytes of a binary (P6) ppm pixel
+inline void write_color_bytes(std::ostream& out, color pixel_color, int samples_per_pixel){
+    auto scale = 1.0 / samples_per_pixel;
+    auto r = linear_to_gamma(pixel_color.x() * scale);
+    auto g = linear_to_gamma(pixel_color.y() * scale);
+    auto b = linear_to_gamma(pixel_color.z() * scale);
+
+    static const interval intensity(0.000, 0.999);
+
+    out.put(static_cast<char>(static_cast<int>(256 * intensity.clamp(r))));
+    out.put(static_cast<char>(static_cast<int>(256 * intensity.clamp(g))));
+    out.put(static_cast<char>(static_cast<int>(256 * intensity.clamp(b))));
+}
 
 #endif
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define HITTABLE_H
 
 #include "ray.h"
+#include "aabb.h"
 
 class material;   // tells the compiler that this class will be defined later, solves circular import issue
 
@@ -24,6 +25,7 @@ class hittable{
     public:
         virtual ~hittable(){};
         virtual bool hit(ray& r, interval ray_t, hit_record& rec) const = 0;
+        virtual aabb bounding_box() const = 0;
 };
 
 #endif
\ No newline at end of file
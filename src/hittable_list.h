@@ -36,6 +36,15 @@ class hittable_list : public hittable {
 
             return hit_anything;    
         }
+
+        // computed on demand rather than cached, since objects may be moved after they are added
+        aabb bounding_box() const override {
+            aabb bbox;
+            for(const auto& object : objects){
+                bbox = aabb(bbox, object->bounding_box());
+            }
+            return bbox;
+        }
 };
 
 
@@ -10,6 +10,7 @@ class interval{
 
         interval(double _min, double _max) : min(_min), max(_max){}
         interval() : min(infinity), max(-infinity) {}
+        interval(const interval& a, const interval& b) : min(fmin(a.min, b.min)), max(fmax(a.max, b.max)) {}  // tightest interval enclosing both
 
         bool contains(double x) const {  
             return x >= min && x <= max;
@@ -25,6 +26,10 @@ class interval{
             return x;
         }
 
+        double size() const {
+            return max - min;
+        }
+
 };
 
 static const interval empty(infinity, -infinity);
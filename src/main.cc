@@ -1,14 +1,129 @@
 #include <iostream>
+#include <chrono>
+#include <string>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
 #include "rtweekend.h"
 
 #include "hittable.h"
 #include "hittable_list.h"
 #include "sphere.h"
+#include "bvh.h"
 #include "camera.h"
+#include "preview.h"
+#include "mesh.h"
+
+// moves the small spheres a little every frame and compares refitting the bvh against building it from scratch
+void benchmark_refit(const hittable_list& world, bvh& world_bvh, std::vector<shared_ptr<sphere>>& movers, int frames){
+    using clock = std::chrono::steady_clock;
+
+    double refit_ms = 0;
+    double rebuild_ms = 0;
+    int subtrees_rebuilt = 0;
+
+    for(int f = 0; f < frames; f++){
+        for(auto& s : movers){
+            s->set_centre(s->get_centre() + 0.05 * vec3::random(-1, 1));
+        }
+
+        auto start = clock::now();
+        subtrees_rebuilt += world_bvh.refit();
+        auto refitted = clock::now();
+        bvh reference(world);
+        auto rebuilt = clock::now();
+
+        refit_ms += std::chrono::duration<double, std::milli>(refitted - start).count();
+        rebuild_ms += std::chrono::duration<double, std::milli>(rebuilt - refitted).count();
+
+        std::clog << "\rFrame " << f+1 << "/" << frames
+        << "  SAH cost refit: " << world_bvh.sah_cost() << "  rebuilt: " << reference.sah_cost() << std::flush;
+    }
+
+    std::clog << "\n" << movers.size() << " of " << world.objects.size() << " spheres moving\n"
+    << "refit:   " << refit_ms / frames << " ms/frame, " << subtrees_rebuilt << " subtrees rebuilt\n"
+    << "rebuild: " << rebuild_ms / frames << " ms/frame\n";
+}
+
+// flies the camera around the scene and then holds it still so the preview can refine. frames go to path,
+// or to stdout as a stream of ppm images if path is "-". returns false if a frame could not be written
+bool run_preview(const hittable& world, camera& cam, const std::string& path, int frames){
+    previewer preview(cam);
+    auto start = cam.lookfrom;
+
+    for(int f = 0; f < frames; f++){
+        if(f < frames / 2){
+            auto angle = 2 * pi * f / frames;
+            cam.lookfrom = point3(start.x()*cos(angle) - start.z()*sin(angle), start.y(), start.x()*sin(angle) + start.z()*cos(angle));
+        }
+
+        auto frame_ms = path == "-" ? preview.frame(world, std::cout) : preview.frame(world, path);
+        if(frame_ms < 0 || !std::cout){
+            return false;
+        }
+
+        std::clog << "\rFrame " << f+1 << "/" << frames << "  " << frame_ms << " ms  " << std::flush;
+    }
+
+    std::clog << '\n';
+    preview.report(std::clog);
+    return true;
+}
+
+int main(int argc, char* argv[]){
+    // Options
+    std::string obj_path;      // --obj <file> [--compact] adds a triangle mesh to the scene
+    bool compact_mesh = false;
+    std::string preview_path;  // --preview <file|-> [frames]
+    int preview_frames = 120;
+    bool bench_refit = false;  // --bench-refit [frames]
+    int bench_frames = 100;
+
+    // frame counts are optional, so a following argument is only taken as one if it starts with a digit.
+    // it then has to be a whole positive number that fits in an int
+    auto next_is_number = [&](int k){
+        return k + 1 < argc && isdigit(static_cast<unsigned char>(argv[k+1][0]));
+    };
+
+    auto parse_frames = [](const char* s, int& frames){
+        char* end;
+        errno = 0;
+        long value = std::strtol(s, &end, 10);
+
+        if(*end != '\0' || errno == ERANGE || value <= 0 || value > INT_MAX) return false;
+
+        frames = static_cast<int>(value);
+        return true;
+    };
+
+    for(int k = 1; k < argc; k++){
+        std::string arg = argv[k];
+        bool valid = true;
+
+        if(arg == "--obj" && k + 1 < argc){
+            obj_path = argv[++k];
+        } else if(arg == "--compact"){
+            compact_mesh = true;
+        } else if(arg == "--preview" && k + 1 < argc){
+            preview_path = argv[++k];
+            if(next_is_number(k)) valid = parse_frames(argv[++k], preview_frames);
+        } else if(arg == "--bench-refit"){
+            bench_refit = true;
+            if(next_is_number(k)) valid = parse_frames(argv[++k], bench_frames);
+        } else {
+            valid = false;
+        }
+
+        if(!valid){
+            std::cerr << "Unknown option " << argv[k] << '\n';
+            return 1;
+        }
+    }
 
-int main(){
     // World
     hittable_list world;
+    std::vector<shared_ptr<sphere>> small_spheres;  // kept around so the refit benchmark can move them
 
     auto material_ground = make_shared<lambertian>(color(0.2, 0.5, 0.5));
     world.add(make_shared<sphere>(point3(0.0, -1000, 0.0), 1000, material_ground));
@@ -25,19 +140,20 @@ int main(){
                     // choose diffuse
                     auto albedo = color::random() * color::random();
                     sphere_material = make_shared<lambertian>(albedo);
-                    world.add(make_shared<sphere>(centre, 0.2, sphere_material));
 
                 } else if (choose_mat < 0.75){
                     // choose dielectric
                     sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(centre, 0.2, sphere_material));
                 } else {
                     // choose metal
                     auto albedo = color::random(0.5, 1);
                     auto fuzz = double_random(0, 0.5);
                     sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(centre, 0.2, sphere_material));
                 }
+
+                auto small_sphere = make_shared<sphere>(centre, 0.2, sphere_material);
+                small_spheres.push_back(small_sphere);
+                world.add(small_sphere);
             }
         }
     }
@@ -52,6 +168,28 @@ int main(){
     auto material3 = make_shared<dielectric>(1.5);
     world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material3));
 
+    if(!obj_path.empty()){
+        auto start = std::chrono::steady_clock::now();
+        auto mesh = make_shared<triangle_mesh>(make_shared<lambertian>(color(0.5, 0.5, 0.5)), compact_mesh, compact_mesh);
+
+        if(!mesh->load_obj(obj_path)){
+            return 1;
+        }
+
+        auto load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::clog << "Loaded " << mesh->triangle_count() << " triangles, " << mesh->vertex_count() << " vertices in "
+        << load_ms << " ms, " << mesh->memory_usage() / (1024.0 * 1024.0) << " MiB\n";
+
+        world.add(mesh);
+    }
+
+    bvh world_bvh(world);
+
+    if(bench_refit){
+        benchmark_refit(world, world_bvh, small_spheres, bench_frames);
+        return 0;
+    }
+
     // Camera
     camera cam;
     cam.ascpect_ratio = 16.0 / 9.0;
@@ -67,5 +205,9 @@ int main(){
     cam.defocus_angle = 0.2;
     cam.focus_dist = 10.0;
 
-    cam.render(world);
+    if(!preview_path.empty()){
+        return run_preview(world_bvh, cam, preview_path, preview_frames) ? 0 : 1;
+    }
+
+    cam.render(world_bvh);
 }
\ No newline at end of file
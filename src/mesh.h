@@ -0,0 +1,429 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "bvh.h"
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cstdlib>
+#include <unordered_map>
+
+// indexed triangle mesh with a single material. vertices are stored once and shared between triangles, and
+// the mesh builds its own bvh over triangle indices, so no per-triangle hittable objects are ever created
+class triangle_mesh : public hittable{
+    public:
+        // quantize_positions stores each coordinate as 16 bits relative to the mesh bounds, encode_normals stores
+        // vertex normals in 32 bits using an octahedral mapping. both are applied when build() is called
+        triangle_mesh(shared_ptr<material> _mat, bool _quantize_positions = false, bool _encode_normals = false)
+        : mat(_mat), quantize_positions(_quantize_positions), encode_normals(_encode_normals) {}
+
+        int vertex_count() const {return vertex_total;}
+        int triangle_count() const {return static_cast<int>(indices.size() / 3);}
+
+        // vertices and triangles can only be added before build(), which may repack the vertex buffers
+        int add_vertex(const point3& p){
+            positions.push_back(static_cast<float>(p.x()));
+            positions.push_back(static_cast<float>(p.y()));
+            positions.push_back(static_cast<float>(p.z()));
+            return vertex_total++;
+        }
+
+        // vertex normals are optional. if some vertices have one, the rest get the average of the faces around
+        // them when build() is called. zero length or non finite normals are ignored, leaving the vertex without one
+        void set_normal(int vertex, const vec3& n){
+            auto length = n.length();
+            if(!(length > 0) || !std::isfinite(length)) return;
+
+            if(normals.size() < positions.size()){
+                normals.resize(positions.size(), 0.0f);
+            }
+            if(has_normal.size() < normals.size() / 3){
+                has_normal.resize(normals.size() / 3, false);
+            }
+
+            has_normal[vertex] = true;
+            auto unit = n / length;
+            normals[3*vertex]   = static_cast<float>(unit.x());
+            normals[3*vertex+1] = static_cast<float>(unit.y());
+            normals[3*vertex+2] = static_cast<float>(unit.z());
+        }
+
+        void add_triangle(int a, int b, int c){
+            indices.push_back(static_cast<uint32_t>(a));
+            indices.push_back(static_cast<uint32_t>(b));
+            indices.push_back(static_cast<uint32_t>(c));
+        }
+
+        // compacts the vertex data and builds the bvh, must be called after the last vertex or triangle is added
+        void build(){
+            if(!normals.empty()) fill_missing_normals();
+            if(quantize_positions) quantize();
+            if(encode_normals && !normals.empty()) encode();
+
+            std::vector<aabb> prim_boxes(triangle_count());
+            for(int tri = 0; tri < triangle_count(); tri++){
+                prim_boxes[tri] = aabb(aabb(vertex(indices[3*tri]), vertex(indices[3*tri+1])), aabb(vertex(indices[3*tri+2]), vertex(indices[3*tri+2])));
+            }
+
+            // store the triangles in bvh order, so leaves index them directly
+            auto order = tree.build(prim_boxes);
+            std::vector<uint32_t> ordered(indices.size());
+            for(size_t k = 0; k < order.size(); k++){
+                for(int c = 0; c < 3; c++){
+                    ordered[3*k+c] = indices[3*order[k]+c];
+                }
+            }
+            indices.swap(ordered);
+
+            // drop the slack left by loading one vertex at a time
+            positions.shrink_to_fit();
+            normals.shrink_to_fit();
+        }
+
+        // streams an OBJ file straight into the vertex and index buffers of an empty mesh. only positions,
+        // normals and faces are read, polygons are triangulated as fans. returns false and prints the reason if the
+        // file can't be used
+        bool load_obj(const std::string& path){
+            if(vertex_total > 0 || !indices.empty()){
+                std::cerr << "Could not load " << path << ": the mesh already has geometry\n";
+                return false;
+            }
+
+            std::ifstream in(path);
+            if(!in){
+                std::cerr << "Could not open " << path << '\n';
+                return false;
+            }
+
+            // OBJ normals belong to face corners rather than positions. each position becomes a mesh vertex with
+            // the normal it is first used with, and gets a copy for every other normal it is used with, so hard
+            // edges keep their face normals
+            const int unused = -2;
+            std::vector<float> obj_normals;
+            std::vector<int> obj_vertices;     // mesh vertex made for each OBJ position
+            std::vector<int> vertex_normals;   // OBJ normal each mesh vertex was made for, -1 for none
+            std::unordered_map<uint64_t, int> seam_vertices;  // (position, normal) pairs that needed a copy
+            std::vector<int> corners;
+            std::string line;
+            int line_number = 0;
+
+            while(std::getline(in, line)){
+                line_number++;
+                const char* p = line.c_str();
+
+                if(p[0] == 'v' && p[1] == ' '){
+                    p += 2;
+                    auto x = parse_number(p);
+                    auto y = parse_number(p);
+                    auto z = parse_number(p);
+                    obj_vertices.push_back(add_vertex(point3(x, y, z)));
+                    vertex_normals.push_back(unused);
+
+                } else if(p[0] == 'v' && p[1] == 'n' && p[2] == ' '){
+                    p += 3;
+                    for(int k = 0; k < 3; k++){
+                        obj_normals.push_back(static_cast<float>(parse_number(p)));
+                    }
+
+                } else if(p[0] == 'f' && p[1] == ' '){
+                    p += 2;
+                    corners.clear();
+
+                    while(true){
+                        while(*p == ' ' || *p == '\t' || *p == '\r') p++;
+                        if(*p == '\0') break;
+
+                        auto start = p;
+                        long vi = parse_index(p);
+                        long ni = 0;
+                        if(p == start){
+                            std::cerr << path << ':' << line_number << ": bad face\n";
+                            return false;
+                        }
+
+                        // v, v/vt, v//vn or v/vt/vn, texture coordinates are skipped
+                        if(*p == '/'){
+                            p++;
+                            if(*p != '/') parse_index(p);
+                            if(*p == '/') ni = parse_index(++p);
+                        }
+
+                        // OBJ indices start at 1, negative ones count back from the last element read
+                        long ov = vi < 0 ? static_cast<long>(obj_vertices.size()) + vi : vi - 1;
+                        long n = ni < 0 ? static_cast<long>(obj_normals.size() / 3) + ni : ni - 1;
+
+                        if(vi == 0 || ov < 0 || ov >= static_cast<long>(obj_vertices.size())
+                            || (ni != 0 && (n < 0 || 3*n >= static_cast<long>(obj_normals.size())))){
+                            std::cerr << path << ':' << line_number << ": face index out of range\n";
+                            return false;
+                        }
+
+                        int v = obj_vertices[ov];
+
+                        if(vertex_normals[v] == unused){
+                            vertex_normals[v] = static_cast<int>(n);
+                            if(n >= 0) set_normal(v, vec3(obj_normals[3*n], obj_normals[3*n+1], obj_normals[3*n+2]));
+
+                        } else if(vertex_normals[v] != n){
+                            auto key = (static_cast<uint64_t>(ov) << 32) | static_cast<uint32_t>(n + 1);
+                            auto seam = seam_vertices.find(key);
+
+                            if(seam == seam_vertices.end()){
+                                int copy = add_vertex(vertex(v));
+                                vertex_normals.push_back(static_cast<int>(n));
+                                if(n >= 0) set_normal(copy, vec3(obj_normals[3*n], obj_normals[3*n+1], obj_normals[3*n+2]));
+                                seam = seam_vertices.emplace(key, copy).first;
+                            }
+
+                            v = seam->second;
+                        }
+
+                        corners.push_back(v);
+                    }
+
+                    for(size_t k = 2; k < corners.size(); k++){
+                        add_triangle(corners[0], corners[k-1], corners[k]);
+                    }
+                }
+            }
+
+            build();
+            return true;
+        }
+
+        // bytes held by the vertex, index and bvh buffers
+        size_t memory_usage() const {
+            return positions.capacity() * sizeof(float) + qpositions.capacity() * sizeof(uint16_t)
+                + normals.capacity() * sizeof(float) + onormals.capacity() * sizeof(uint32_t)
+                + indices.capacity() * sizeof(uint32_t) + tree.nodes.capacity() * sizeof(static_bvh_node);
+        }
+
+        bool hit(ray& r, interval ray_t, hit_record& rec) const override {
+            auto origin = r.origin();
+            auto dir = r.direction();
+
+            // per ray setup of the watertight test (Woop, Benthin and Wald 2013). the axis where the direction is
+            // largest becomes z, and the triangles are sheared so the ray runs along +z from the origin
+            int kz = fabs(dir.x()) > fabs(dir.y()) ? (fabs(dir.x()) > fabs(dir.z()) ? 0 : 2) : (fabs(dir.y()) > fabs(dir.z()) ? 1 : 2);
+            int kx = (kz + 1) % 3;
+            int ky = (kx + 1) % 3;
+            if(dir[kz] < 0) std::swap(kx, ky);  // keeps the winding of the sheared triangles consistent
+
+            double sx = dir[kx] / dir[kz];
+            double sy = dir[ky] / dir[kz];
+            double sz = 1.0 / dir[kz];
+
+            int closest = -1;
+            double closest_t = 0, closest_u = 0, closest_v = 0;
+
+            tree.hit(r, ray_t, [&](int tri, interval tri_t, double& t){
+                auto a = vertex(indices[3*tri]) - origin;
+                auto b = vertex(indices[3*tri+1]) - origin;
+                auto c = vertex(indices[3*tri+2]) - origin;
+
+                double ax = a[kx] - sx*a[kz], ay = a[ky] - sy*a[kz];
+                double bx = b[kx] - sx*b[kz], by = b[ky] - sy*b[kz];
+                double cx = c[kx] - sx*c[kz], cy = c[ky] - sy*c[kz];
+
+                // scaled barycentrics. each is the edge function of the edge opposite a vertex, written as
+                // q.x*p.y - q.y*p.x for the edge p -> q. a neighbouring triangle walks the shared edge the other way
+                // and computes exactly the negated value from the same products, so a ray through the edge can't
+                // miss both triangles. that only holds while the products are rounded separately, which is why the
+                // build turns off floating point contraction into fused multiply-adds
+                double u = cx*by - cy*bx;
+                double v = ax*cy - ay*cx;
+                double w = bx*ay - by*ax;
+
+                // a zero edge function means the ray passes exactly through that edge, which counts as a hit
+                if((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0)) return false;
+
+                double det = u + v + w;
+                if(det == 0) return false;
+
+                double hit_t = (u*sz*a[kz] + v*sz*b[kz] + w*sz*c[kz]) / det;
+                if(!tri_t.surrounds(hit_t)) return false;
+
+                closest = tri;
+                closest_t = t = hit_t;
+                closest_u = v / det;  // weight of b
+                closest_v = w / det;  // weight of c
+                return true;
+            });
+
+            if(closest < 0) return false;
+
+            // only the closest hit gets shaded
+            auto ia = indices[3*closest], ib = indices[3*closest+1], ic = indices[3*closest+2];
+            auto a = vertex(ia);
+            vec3 outward_normal = cross(vertex(ib) - a, vertex(ic) - a);
+
+            if(has_normals()){
+                auto interpolated = (1 - closest_u - closest_v) * normal(ia) + closest_u * normal(ib) + closest_v * normal(ic);
+                if(!interpolated.near_zero()) outward_normal = interpolated;
+            }
+
+            rec.t = closest_t;
+            rec.p = r.at(rec.t);
+            rec.set_normal(r, unit_vector(outward_normal));
+            rec.mat = mat;
+
+            return true;
+        }
+
+        aabb bounding_box() const override {
+            return tree.bounding_box();
+        }
+
+    private:
+        shared_ptr<material> mat;
+        bool quantize_positions;
+        bool encode_normals;
+        int vertex_total = 0;
+
+        std::vector<float> positions;     // xyz per vertex, emptied once quantized
+        std::vector<uint16_t> qpositions; // xyz per vertex as fractions of the mesh bounds
+        point3 qorigin;
+        vec3 qscale;
+
+        std::vector<float> normals;       // xyz per vertex, empty if the mesh has no vertex normals
+        std::vector<bool> has_normal;     // which vertices have a normal, a bit per vertex
+        std::vector<uint32_t> onormals;   // octahedral encoded normals, replaces normals when enabled
+
+        std::vector<uint32_t> indices;    // three vertex indices per triangle
+        static_bvh tree;
+
+        point3 vertex(uint32_t i) const {
+            if(!qpositions.empty()){
+                return qorigin + qscale * vec3(qpositions[3*i], qpositions[3*i+1], qpositions[3*i+2]);
+            }
+            return point3(positions[3*i], positions[3*i+1], positions[3*i+2]);
+        }
+
+        bool has_normals() const {
+            return !normals.empty() || !onormals.empty();
+        }
+
+        vec3 normal(uint32_t i) const {
+            if(!onormals.empty()){
+                return oct_decode(onormals[i]);
+            }
+            return vec3(normals[3*i], normals[3*i+1], normals[3*i+2]);
+        }
+
+        static double parse_number(const char*& p){
+            char* end;
+            auto x = std::strtod(p, &end);
+            p = end;
+            return x;
+        }
+
+        static long parse_index(const char*& p){
+            char* end;
+            auto i = std::strtol(p, &end, 10);
+            p = end;
+            return i;
+        }
+
+        // vertices that were given no normal get the area weighted average of the faces around them
+        void fill_missing_normals(){
+            normals.resize(positions.size(), 0.0f);
+
+            std::vector<bool> missing(vertex_total);
+            for(int i = 0; i < vertex_total; i++){
+                missing[i] = i >= static_cast<int>(has_normal.size()) || !has_normal[i];
+            }
+
+            for(int tri = 0; tri < triangle_count(); tri++){
+                auto a = vertex(indices[3*tri]);
+                auto face_normal = cross(vertex(indices[3*tri+1]) - a, vertex(indices[3*tri+2]) - a);
+
+                for(int k = 0; k < 3; k++){
+                    auto i = indices[3*tri+k];
+                    if(!missing[i]) continue;
+
+                    normals[3*i]   += static_cast<float>(face_normal.x());
+                    normals[3*i+1] += static_cast<float>(face_normal.y());
+                    normals[3*i+2] += static_cast<float>(face_normal.z());
+                }
+            }
+
+            for(int i = 0; i < vertex_total; i++){
+                if(missing[i]){
+                    set_normal(i, normal(i));
+                }
+            }
+        }
+
+        void quantize(){
+            if(positions.empty()) return;
+
+            aabb bounds;
+            for(int i = 0; i < vertex_total; i++){
+                auto p = vertex(i);
+                bounds = aabb(bounds, aabb(p, p));
+            }
+
+            qorigin = point3(bounds.x.min, bounds.y.min, bounds.z.min);
+            qscale = vec3(bounds.x.size() / 65535, bounds.y.size() / 65535, bounds.z.size() / 65535);
+
+            std::vector<uint16_t> q(positions.size());
+            for(size_t k = 0; k < positions.size(); k++){
+                auto scale = qscale[k % 3];
+                q[k] = scale > 0 ? static_cast<uint16_t>((positions[k] - qorigin[k % 3]) / scale + 0.5) : 0;
+            }
+
+            qpositions.swap(q);
+            std::vector<float>().swap(positions);
+        }
+
+        void encode(){
+            std::vector<uint32_t> encoded(vertex_total);
+            for(int i = 0; i < vertex_total; i++){
+                encoded[i] = oct_encode(vec3(normals[3*i], normals[3*i+1], normals[3*i+2]));
+            }
+
+            onormals.swap(encoded);
+            std::vector<float>().swap(normals);
+        }
+
+        // the unit sphere is projected onto an octahedron and unfolded into a square, which keeps the
+        // precision close to uniform over all directions. 16 bits per coordinate, every code is a valid direction
+        static uint32_t oct_encode(const vec3& n){
+            auto l1 = fabs(n.x()) + fabs(n.y()) + fabs(n.z());
+
+            // only vertices of degenerate faces are left without a normal, and those faces are never hit
+            if(l1 == 0) return oct_encode(vec3(0, 0, 1));
+
+            auto x = n.x() / l1;
+            auto y = n.y() / l1;
+
+            if(n.z() < 0){
+                auto fx = (1 - fabs(y)) * (x >= 0 ? 1 : -1);
+                auto fy = (1 - fabs(x)) * (y >= 0 ? 1 : -1);
+                x = fx;
+                y = fy;
+            }
+
+            auto qx = static_cast<uint32_t>((x * 0.5 + 0.5) * 65535 + 0.5);
+            auto qy = static_cast<uint32_t>((y * 0.5 + 0.5) * 65535 + 0.5);
+            return (qx << 16) | qy;
+        }
+
+        static vec3 oct_decode(uint32_t e){
+            auto x = (e >> 16) / 65535.0 * 2 - 1;
+            auto y = (e & 0xffff) / 65535.0 * 2 - 1;
+            auto z = 1 - fabs(x) - fabs(y);
+
+            // fold the lower hemisphere back
+            auto fold = fmax(-z, 0.0);
+            x += x >= 0 ? -fold : fold;
+            y += y >= 0 ? -fold : fold;
+
+            return unit_vector(vec3(x, y, z));
+        }
+};
+
+#endif
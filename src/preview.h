@@ -0,0 +1,204 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "camera.h"
+#include <vector>
+#include <string>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+
+// low latency preview of a camera. every frame traces one sample per pixel at a reduced resolution and adds it
+// to the samples accumulated so far. while the camera is still the image keeps refining, and when it moves the
+// accumulated samples are reprojected into the new view using the depth of the primary hits
+class previewer{
+    public:
+        double target_frame_ms = 33.0;  // resolution is adjusted to keep frame times around this
+        int max_depth = 8;              // bounce limit, lower than a final render to keep frames cheap
+        int max_reprojected_samples = 8;  // reprojected history is capped so stale samples fade out quickly
+        double depth_tolerance = 0.05;    // relative depth difference above which history is treated as disoccluded
+        int downscale = 4;
+        int max_downscale = 16;
+
+        previewer(camera& _cam) : cam(_cam) {}
+
+        // renders one frame and writes it to out as a binary ppm, returns the frame time in milliseconds
+        double frame(const hittable& world, std::ostream& out){
+            auto start = std::chrono::steady_clock::now();
+
+            camera view = cam;
+            view.image_width = std::max(1, cam.image_width / downscale);
+            view.samples_per_pixel = 1;
+            view.initialise();
+
+            bool held = has_history && same_pose(view, history_view);  // camera hasn't moved since the last frame
+            bool still = held && view.image_width == history_view.image_width && view.image_height == history_view.image_height;
+            std::vector<color> new_accum(view.image_width * view.image_height);
+            std::vector<int> new_samples(new_accum.size());
+            std::vector<double> new_depth(new_accum.size());
+
+            for(int j = 0; j < view.image_height; ++j){
+                for(int i = 0; i < view.image_width; ++i){
+                    int idx = j * view.image_width + i;
+
+                    ray r = view.get_ray(i, j);
+                    double depth = infinity;  // left as is by ray_color if max_depth allows no bounce at all
+                    color pixel_color = view.ray_color(r, max_depth, world, &depth);
+
+                    int history = -1;
+                    int history_samples = 0;
+
+                    if(still){
+                        history = idx;
+                        history_samples = samples[idx];
+                    } else if(has_history){
+                        history = reproject(r, depth);
+                        history_samples = history < 0 ? 0 : std::min(samples[history], max_reprojected_samples);
+                    }
+
+                    if(history_samples > 0){
+                        // rescale the history to the number of samples it is allowed to count for
+                        pixel_color += (static_cast<double>(history_samples) / samples[history]) * accum[history];
+                    }
+
+                    new_accum[idx] = pixel_color;
+                    new_samples[idx] = history_samples + 1;
+                    new_depth[idx] = depth;
+                }
+            }
+
+            accum.swap(new_accum);
+            samples.swap(new_samples);
+            depths.swap(new_depth);
+            history_view = view;
+            has_history = true;
+
+            out << "P6\n" << view.image_width << ' ' << view.image_height << "\n255\n";
+            for(size_t k = 0; k < accum.size(); k++){
+                write_color_bytes(out, accum[k], samples[k]);
+            }
+            out.flush();
+
+            auto frame_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            frame_times.push_back(frame_ms);
+
+            // the resolution is frozen while the camera is held, since changing it would resample the history
+            // through reproject and cap its samples
+            if(!held) adapt_resolution(frame_ms);
+
+            return frame_ms;
+        }
+
+        // writes the frame to a temporary file and renames it over path, so a viewer watching path never
+        // reads a partly written frame. returns a negative time and prints the reason if the file can't be written
+        double frame(const hittable& world, const std::string& path){
+            auto tmp_path = path + ".tmp";
+            double frame_ms;
+            {
+                std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+                if(!out){
+                    std::cerr << "Could not open " << tmp_path << '\n';
+                    return -1;
+                }
+
+                frame_ms = frame(world, out);
+                if(!out){
+                    std::cerr << "Could not write " << tmp_path << '\n';
+                    return -1;
+                }
+            }
+
+            if(std::rename(tmp_path.c_str(), path.c_str()) != 0){
+                std::cerr << "Could not rename " << tmp_path << " to " << path << '\n';
+                return -1;
+            }
+
+            return frame_ms;
+        }
+
+        // prints frame latency percentiles over every frame rendered so far
+        void report(std::ostream& out) const {
+            if(frame_times.empty()) return;
+
+            auto sorted = frame_times;
+            std::sort(sorted.begin(), sorted.end());
+
+            auto percentile = [&](double p){
+                auto k = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+                return sorted[k];
+            };
+
+            out << sorted.size() << " frames, latency (ms)"
+            << "  p50: " << percentile(0.50)
+            << "  p90: " << percentile(0.90)
+            << "  p99: " << percentile(0.99)
+            << "  max: " << sorted.back() << '\n';
+        }
+
+    private:
+        camera& cam;
+        camera history_view;  // the view the accumulated samples were rendered with
+        bool has_history = false;
+
+        std::vector<color> accum;
+        std::vector<int> samples;
+        std::vector<double> depths;   // distance to the primary hit of each pixel, infinity for the sky
+        std::vector<double> frame_times;
+
+        static bool same_point(const point3& a, const point3& b){
+            return (a - b).near_zero();
+        }
+
+        static bool same_pose(const camera& a, const camera& b){
+            return same_point(a.lookfrom, b.lookfrom) && same_point(a.lookto, b.lookto) && same_point(a.vup, b.vup)
+                && a.vfov == b.vfov && a.defocus_angle == b.defocus_angle && a.focus_dist == b.focus_dist;
+        }
+
+        // finds the pixel of the history view that saw the primary hit of r, or -1 if it was off screen or hidden
+        int reproject(ray& r, double depth){
+            const auto& prev = history_view;
+            bool sky = depth == infinity;
+
+            // the sky is projected from a point far along the ray, which only depends on its direction
+            auto p = r.origin() + (sky ? 1e6 : depth) * unit_vector(r.direction());
+
+            // project onto the previous focus plane through the lens centre, defocus is ignored
+            auto d = p - prev.camera_centre;
+            auto along = -dot(d, prev.w);
+            if(along <= 0) return -1;
+
+            auto q = prev.camera_centre + (prev.focus_dist / along) * d - prev.pixel00_loc;
+            auto i = static_cast<int>(floor(dot(q, prev.pixel_delta_u) / prev.pixel_delta_u.length_squared() + 0.5));
+            auto j = static_cast<int>(floor(dot(q, prev.pixel_delta_v) / prev.pixel_delta_v.length_squared() + 0.5));
+
+            if(i < 0 || i >= prev.image_width || j < 0 || j >= prev.image_height) return -1;
+
+            int idx = j * prev.image_width + i;
+            auto prev_depth = depths[idx];
+
+            if(sky || prev_depth == infinity){
+                return sky && prev_depth == infinity ? idx : -1;
+            }
+
+            auto expected = d.length();
+            return fabs(expected - prev_depth) <= depth_tolerance * prev_depth ? idx : -1;
+        }
+
+        // trade resolution for frame time, the next frame reprojects the history to the new resolution.
+        // a finer resolution is only picked when its predicted frame time still fits, to avoid flip-flopping
+        void adapt_resolution(double frame_ms){
+            if(frame_ms > 1.25 * target_frame_ms && downscale < max_downscale){
+                downscale++;
+            } else if(downscale > 1){
+                auto ratio = static_cast<double>(downscale) / (downscale - 1);
+                if(frame_ms * ratio * ratio < target_frame_ms){
+                    downscale--;
+                }
+            }
+        }
+};
+
+#endif
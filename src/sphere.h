@@ -39,6 +39,18 @@ class sphere : public hittable{
             return true;    
         }
 
+        aabb bounding_box() const override {
+            auto rvec = vec3(radius, radius, radius);
+            return aabb(centre - rvec, centre + rvec);
+        }
+
+        // spheres can be moved in place for dynamic scenes, any bvh containing them must be refit afterwards
+        point3 get_centre() const {return centre;}
+        double get_radius() const {return radius;}
+
+        void set_centre(const point3& _centre){centre = _centre;}
+        void set_radius(double _radius){radius = _radius;}
+
     private:
         point3 centre;
         double radius;